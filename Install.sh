@@ -119,6 +119,10 @@ REQUIRED_FILES=(
     "CMakeLists.txt"
     "plugins/providers/nextcloudprovider.cpp"
     "plugins/providers/nextcloudprovider.h"
+    "plugins/providers/nextcloudprefetcher.cpp"
+    "plugins/providers/nextcloudprefetcher.h"
+    "plugins/providers/nextcloudutils.cpp"
+    "plugins/providers/nextcloudutils.h"
     "plugins/providers/nextcloudprovider.json"
     "plugins/providers/potdprovider.h"
     "plugins/providers/plasma_potd_export.h"
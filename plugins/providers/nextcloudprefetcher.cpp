@@ -0,0 +1,409 @@
+/*
+ *   SPDX-FileCopyrightText: 2024 Nextcloud Wallpaper Plugin
+ *
+ *   SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "nextcloudprefetcher.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QNetworkInformation>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QPointer>
+#include <QRandomGenerator>
+#include <QXmlStreamReader>
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "debug.h"
+#include "nextcloudutils.h"
+
+namespace
+{
+// How long to wait before re-checking when preparation is deferred (metered / battery)
+constexpr int DeferRetryMs = 15 * 60 * 1000;
+
+// Abort a request when no data arrived for this long, a stalled transfer must not block later runs
+constexpr int TransferTimeoutMs = 60 * 1000;
+
+// Puts the calling worker thread into the idle I/O scheduling class so that
+// reading and decoding the next wallpaper never competes with interactive work
+void lowerIoPriority()
+{
+#ifdef Q_OS_LINUX
+    constexpr int ioprioWhoProcess = 1; // IOPRIO_WHO_PROCESS, 0 = calling thread
+    constexpr int ioprioClassIdle = 3; // IOPRIO_CLASS_IDLE
+    constexpr int ioprioClassShift = 13;
+    syscall(SYS_ioprio_set, ioprioWhoProcess, 0, ioprioClassIdle << ioprioClassShift);
+#endif
+}
+
+QString readSysfsValue(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    return QString::fromLatin1(file.readAll()).trimmed();
+}
+}
+
+QString NextcloudPrefetcher::Settings::sourceKey() const
+{
+    if (useLocalPath) {
+        return QStringLiteral("local:") + localPath + QLatin1Char(':') + QString::number(maxImages);
+    }
+    return nextcloudUrl + nextcloudPath + QLatin1Char(':') + username + QLatin1Char(':') + QString::number(maxImages);
+}
+
+NextcloudPrefetcher *NextcloudPrefetcher::instance()
+{
+    // Parented to the application: the provider itself is short-lived (one per rotation)
+    static QPointer<NextcloudPrefetcher> s_instance;
+    if (!s_instance) {
+        s_instance = new NextcloudPrefetcher(QCoreApplication::instance());
+    }
+    return s_instance;
+}
+
+NextcloudPrefetcher::NextcloudPrefetcher(QObject *parent)
+    : QObject(parent)
+{
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::VeryCoarseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &NextcloudPrefetcher::startPreparation);
+
+    m_manager.setTransferTimeout(TransferTimeoutMs);
+
+    // A single idle-priority worker: preparation is never urgent
+    m_pool.setMaxThreadCount(1);
+    m_pool.setThreadPriority(QThread::IdlePriority);
+}
+
+NextcloudPrefetcher::Prepared NextcloudPrefetcher::takePrepared(const Settings &settings)
+{
+    if (m_prepared.image.isNull() || m_preparedKey != settings.sourceKey()) {
+        return Prepared();
+    }
+
+    // Downscaling was switched or a larger screen appeared since the image was decoded,
+    // let the provider load it again
+    const QSize target = settings.downscale ? NextcloudUtils::screenTargetSize() : QSize();
+    if (m_prepared.target.isValid() != target.isValid()
+        || (target.isValid() && (target.width() > m_prepared.target.width() || target.height() > m_prepared.target.height()))) {
+        qCDebug(WALLPAPERPOTD) << "Dropping prepared image decoded for" << m_prepared.target << "- now need" << target;
+        m_prepared = Prepared();
+        m_preparedKey.clear();
+        return Prepared();
+    }
+
+    Prepared prepared = std::move(m_prepared);
+    m_prepared = Prepared();
+    m_preparedKey.clear();
+    return prepared;
+}
+
+void NextcloudPrefetcher::schedule(const Settings &settings, const QString &currentUrl)
+{
+    if (m_busy) {
+        // A new cycle supersedes whatever is still running, drop its results
+        ++m_run;
+        m_busy = false;
+    }
+    m_settings = settings;
+    m_currentUrl = currentUrl;
+
+    // An image prepared for another source (or with prefetch off) is never used, free it
+    if (!settings.enabled || m_preparedKey != settings.sourceKey()) {
+        m_prepared = Prepared();
+        m_preparedKey.clear();
+    }
+
+    if (!settings.enabled) {
+        m_timer.stop();
+        return;
+    }
+
+    m_deadline = nextRotation();
+    const QDateTime start = m_deadline.addSecs(-qint64(std::max(settings.leadMinutes, 0)) * 60);
+    const qint64 delay = std::max<qint64>(0, QDateTime::currentDateTime().msecsTo(start));
+    qCDebug(WALLPAPERPOTD) << "Next rotation at" << m_deadline << "- preparing next image in" << delay / 1000 << "s";
+    m_timer.start(int(delay));
+}
+
+QDateTime NextcloudPrefetcher::nextRotation()
+{
+    // potd refreshes its providers when the date changes
+    return QDateTime(QDate::currentDate().addDays(1), QTime(0, 0));
+}
+
+bool NextcloudPrefetcher::isOnBattery()
+{
+    // Reads the power supply state from sysfs; without it we assume AC power
+    bool onBattery = false;
+    const QDir powerSupplyDir(QStringLiteral("/sys/class/power_supply"));
+    const QStringList supplies = powerSupplyDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const QString &supply : supplies) {
+        const QString base = powerSupplyDir.filePath(supply) + QLatin1Char('/');
+        // Batteries of peripherals (mice, headsets) do not power the system, UPower ignores them too
+        if (readSysfsValue(base + QStringLiteral("scope")) == QLatin1String("Device")) {
+            continue;
+        }
+        const QString type = readSysfsValue(base + QStringLiteral("type"));
+        if (type == QLatin1String("Mains") && readSysfsValue(base + QStringLiteral("online")) == QLatin1String("1")) {
+            return false;
+        }
+        if (type == QLatin1String("Battery") && readSysfsValue(base + QStringLiteral("status")) == QLatin1String("Discharging")) {
+            onBattery = true;
+        }
+    }
+    return onBattery;
+}
+
+bool NextcloudPrefetcher::isMetered() const
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 4, 0)
+    if (QNetworkInformation::loadBackendByFeatures(QNetworkInformation::Feature::Metered)) {
+        return QNetworkInformation::instance()->isMetered();
+    }
+#endif
+    return false;
+}
+
+void NextcloudPrefetcher::startPreparation()
+{
+    if (m_busy) {
+        return;
+    }
+
+    const QString key = m_settings.sourceKey();
+    if (!m_prepared.image.isNull() && m_preparedKey == key && m_prepared.url != m_currentUrl) {
+        qCDebug(WALLPAPERPOTD) << "Next image already prepared:" << m_prepared.url;
+        return;
+    }
+
+    const bool deferMetered = !m_settings.useLocalPath && !m_settings.allowMetered && isMetered();
+    const bool deferBattery = !m_settings.allowBattery && isOnBattery();
+    if (deferMetered || deferBattery) {
+        const QDateTime now = QDateTime::currentDateTime();
+        if (now.addMSecs(DeferRetryMs) < m_deadline) {
+            qCDebug(WALLPAPERPOTD) << "Deferring next image preparation - metered:" << deferMetered << "battery:" << deferBattery;
+            m_timer.start(DeferRetryMs);
+        } else {
+            qCDebug(WALLPAPERPOTD) << "Skipping next image preparation, rotation will load it directly";
+        }
+        return;
+    }
+
+    m_busy = true;
+    m_runKey = key;
+    const quint64 run = ++m_run;
+    if (m_settings.useLocalPath) {
+        fetchLocalListing(run);
+    } else {
+        checkRemoteEtag(run);
+    }
+}
+
+void NextcloudPrefetcher::checkRemoteEtag(quint64 run)
+{
+    if (m_settings.nextcloudUrl.isEmpty() || m_settings.nextcloudPath.isEmpty() || m_settings.username.isEmpty() || m_settings.password.isEmpty()) {
+        failPreparation(run, QStringLiteral("Nextcloud configuration incomplete"));
+        return;
+    }
+
+    // Depth 0 PROPFIND on the folder: Nextcloud updates a folder etag whenever
+    // anything below it changes, so an unchanged etag means the listing is still valid
+    QNetworkRequest request(QUrl(m_settings.nextcloudUrl + m_settings.nextcloudPath));
+    request.setRawHeader("Depth", "0");
+    request.setRawHeader("Content-Type", "application/xml");
+    request.setRawHeader("Authorization", NextcloudUtils::authorizationHeader(m_settings.username, m_settings.password));
+    request.setPriority(QNetworkRequest::LowPriority);
+
+    QByteArray propfindXml = R"(<?xml version="1.0"?>
+<d:propfind xmlns:d="DAV:">
+  <d:prop>
+    <d:getetag/>
+  </d:prop>
+</d:propfind>)";
+
+    QNetworkReply *reply = m_manager.sendCustomRequest(request, "PROPFIND", propfindXml);
+    connect(reply, &QNetworkReply::finished, this, [this, reply, run]() {
+        reply->deleteLater();
+        if (run != m_run) {
+            return;
+        }
+        if (reply->error() != QNetworkReply::NoError) {
+            failPreparation(run, QStringLiteral("PROPFIND (etag) error: ") + reply->errorString());
+            return;
+        }
+
+        QString etag;
+        QXmlStreamReader xml(reply->readAll());
+        while (!xml.atEnd()) {
+            xml.readNext();
+            if (xml.isStartElement() && xml.name() == QLatin1String("getetag")) {
+                etag = xml.readElementText();
+                break;
+            }
+        }
+
+        if (!etag.isEmpty() && etag == m_listingEtag && m_runKey == m_listingKey && !m_imageUrls.isEmpty()) {
+            qCDebug(WALLPAPERPOTD) << "Folder etag unchanged, reusing listing of" << m_imageUrls.size() << "images";
+            pickAndFetch(run);
+            return;
+        }
+
+        fetchRemoteListing(run, etag);
+    });
+}
+
+void NextcloudPrefetcher::fetchRemoteListing(quint64 run, const QString &etag)
+{
+    QNetworkRequest request(QUrl(m_settings.nextcloudUrl + m_settings.nextcloudPath));
+    request.setRawHeader("Depth", "infinity");
+    request.setRawHeader("Content-Type", "application/xml");
+    request.setRawHeader("Authorization", NextcloudUtils::authorizationHeader(m_settings.username, m_settings.password));
+    request.setPriority(QNetworkRequest::LowPriority);
+
+    QNetworkReply *reply = m_manager.sendCustomRequest(request, "PROPFIND", NextcloudUtils::propfindListingBody());
+    connect(reply, &QNetworkReply::finished, this, [this, reply, run, etag]() {
+        reply->deleteLater();
+        if (run != m_run) {
+            return;
+        }
+        if (reply->error() != QNetworkReply::NoError) {
+            failPreparation(run, QStringLiteral("PROPFIND error: ") + reply->errorString());
+            return;
+        }
+
+        m_imageUrls = NextcloudUtils::parseImageListing(reply->readAll(), m_settings.nextcloudUrl, m_settings.maxImages);
+        m_listingKey = m_runKey;
+        // Only now does the etag describe m_imageUrls
+        m_listingEtag = etag;
+        qCDebug(WALLPAPERPOTD) << "Refreshed listing:" << m_imageUrls.size() << "images";
+        pickAndFetch(run);
+    });
+}
+
+void NextcloudPrefetcher::fetchLocalListing(quint64 run)
+{
+    if (m_settings.localPath.isEmpty() || !QDir(m_settings.localPath).exists()) {
+        failPreparation(run, QStringLiteral("Local path not available: ") + m_settings.localPath);
+        return;
+    }
+
+    // Walking a large synchronized folder is I/O bound, keep it off the GUI thread
+    const QString localPath = m_settings.localPath;
+    const int maxImages = m_settings.maxImages;
+    m_pool.start([this, run, localPath, maxImages]() {
+        lowerIoPriority();
+
+        const QStringList imageUrls = NextcloudUtils::listLocalImages(localPath, maxImages);
+
+        QMetaObject::invokeMethod(
+            this,
+            [this, run, imageUrls]() {
+                if (run != m_run) {
+                    return;
+                }
+                m_imageUrls = imageUrls;
+                m_listingKey = m_runKey;
+                m_listingEtag.clear();
+                pickAndFetch(run);
+            },
+            Qt::QueuedConnection);
+    });
+}
+
+void NextcloudPrefetcher::pickAndFetch(quint64 run)
+{
+    QStringList candidates = m_imageUrls;
+    if (candidates.size() > 1) {
+        candidates.removeAll(m_currentUrl);
+    }
+    if (candidates.isEmpty()) {
+        failPreparation(run, QStringLiteral("No images found"));
+        return;
+    }
+
+    const QString url = candidates.at(QRandomGenerator::global()->bounded(candidates.size()));
+    qCDebug(WALLPAPERPOTD) << "Preparing next image:" << url;
+
+    if (m_settings.useLocalPath) {
+        decode(run, QByteArray(), url, url);
+        return;
+    }
+
+    QNetworkRequest request{QUrl(url)};
+    request.setRawHeader("Authorization", NextcloudUtils::authorizationHeader(m_settings.username, m_settings.password));
+    request.setPriority(QNetworkRequest::LowPriority);
+
+    QNetworkReply *reply = m_manager.get(request);
+    connect(reply, &QNetworkReply::finished, this, [this, reply, run, url]() {
+        reply->deleteLater();
+        if (run != m_run) {
+            return;
+        }
+        if (reply->error() != QNetworkReply::NoError) {
+            failPreparation(run, QStringLiteral("Image download error: ") + reply->errorString());
+            return;
+        }
+        decode(run, reply->readAll(), QString(), url);
+    });
+}
+
+void NextcloudPrefetcher::decode(quint64 run, const QByteArray &data, const QString &path, const QString &url)
+{
+    // Same size as the provider decodes at rotation time
+    const QSize target = m_settings.downscale ? NextcloudUtils::screenTargetSize() : QSize();
+    m_pool.start([this, run, data, path, url, target]() {
+        lowerIoPriority();
+
+        const QImage image = path.isEmpty() ? NextcloudUtils::readImageData(data, target) : NextcloudUtils::readImageFile(path, target);
+
+        QMetaObject::invokeMethod(
+            this,
+            [this, run, url, image, target]() {
+                finishPreparation(run, url, image, target);
+            },
+            Qt::QueuedConnection);
+    });
+}
+
+void NextcloudPrefetcher::finishPreparation(quint64 run, const QString &url, const QImage &image, const QSize &target)
+{
+    if (run != m_run) {
+        return;
+    }
+    if (image.isNull()) {
+        failPreparation(run, QStringLiteral("Failed to decode prepared image ") + url);
+        return;
+    }
+
+    m_busy = false;
+    m_prepared.url = url;
+    m_prepared.image = image;
+    m_prepared.target = target;
+    m_preparedKey = m_runKey;
+    qCDebug(WALLPAPERPOTD) << "Next image ready:" << url << image.size();
+}
+
+void NextcloudPrefetcher::failPreparation(quint64 run, const QString &reason)
+{
+    // Not fatal: the provider falls back to loading the image at rotation time
+    if (run != m_run) {
+        return;
+    }
+    qCWarning(WALLPAPERPOTD) << "Next image preparation failed:" << reason;
+    m_busy = false;
+}
+
+#include "moc_nextcloudprefetcher.cpp"
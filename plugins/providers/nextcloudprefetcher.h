@@ -0,0 +1,109 @@
+/*
+ *   SPDX-FileCopyrightText: 2024 Nextcloud Wallpaper Plugin
+ *
+ *   SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include <QDateTime>
+#include <QImage>
+#include <QNetworkAccessManager>
+#include <QObject>
+#include <QSize>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+
+/**
+ * Process-wide scheduler that prepares the next wallpaper before potd asks for it.
+ *
+ * potd destroys the provider after every rotation, so the prepared image lives in this
+ * singleton (parented to the application) and is handed over to the next provider
+ * instance without any network or decode work on the rotation path.
+ */
+class NextcloudPrefetcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Settings {
+        QString nextcloudUrl;
+        QString nextcloudPath;
+        QString username;
+        QString password;
+        bool useLocalPath = false;
+        QString localPath;
+        int maxImages = 0;
+
+        bool enabled = true;
+        int leadMinutes = 60;
+        bool allowMetered = false;
+        bool allowBattery = false;
+        bool downscale = false;
+
+        /**
+         * Identifies the image source, a prepared image is only valid for the same source
+         */
+        QString sourceKey() const;
+    };
+
+    struct Prepared {
+        QString url;
+        QImage image;
+        // Screen size the image was decoded for, invalid for full resolution
+        QSize target;
+    };
+
+    static NextcloudPrefetcher *instance();
+
+    /**
+     * Returns the image prepared for @p settings and clears the slot.
+     * The returned image is null if nothing is ready.
+     */
+    Prepared takePrepared(const Settings &settings);
+
+    /**
+     * Schedules preparation of the image following @p currentUrl for the next rotation.
+     */
+    void schedule(const Settings &settings, const QString &currentUrl);
+
+private Q_SLOTS:
+    void startPreparation();
+
+private:
+    explicit NextcloudPrefetcher(QObject *parent);
+
+    static QDateTime nextRotation();
+    static bool isOnBattery();
+    bool isMetered() const;
+
+    void checkRemoteEtag(quint64 run);
+    void fetchRemoteListing(quint64 run, const QString &etag);
+    void fetchLocalListing(quint64 run);
+    void pickAndFetch(quint64 run);
+    void decode(quint64 run, const QByteArray &data, const QString &path, const QString &url);
+    void finishPreparation(quint64 run, const QString &url, const QImage &image, const QSize &target);
+    void failPreparation(quint64 run, const QString &reason);
+
+    Settings m_settings;
+    QString m_currentUrl;
+    QDateTime m_deadline;
+    QTimer m_timer;
+    QNetworkAccessManager m_manager;
+    QThreadPool m_pool;
+    bool m_busy = false;
+
+    // Every preparation run gets a number; results of a superseded run are dropped.
+    // schedule() supersedes the running one, so a current run always sees m_settings for m_runKey
+    quint64 m_run = 0;
+    QString m_runKey;
+
+    // Listing cache; for WebDAV it is reused while the folder etag is unchanged
+    QString m_listingKey;
+    QString m_listingEtag;
+    QStringList m_imageUrls;
+
+    Prepared m_prepared;
+    QString m_preparedKey;
+};
@@ -7,16 +7,13 @@
 #include "nextcloudprovider.h"
 
 #include <QDir>
-#include <QDirIterator>
 #include <QFileInfo>
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
 #include <QNetworkReply>
 #include <QAuthenticator>
-#include <QXmlStreamReader>
 #include <QStandardPaths>
 #include <QDateTime>
-#include <QRegularExpression>
 #include <QRandomGenerator>
 #include <QCryptographicHash>
 #include <QFile>
@@ -27,6 +24,7 @@
 #include <KSharedConfig>
 
 #include "debug.h"
+#include "nextcloudutils.h"
 
 Q_LOGGING_CATEGORY(WALLPAPERPOTD, "kde.wallpapers.potd", QtInfoMsg)
 
@@ -34,6 +32,11 @@ NextcloudProvider::NextcloudProvider(QObject *parent, const KPluginMetaData &dat
     : PotdProvider(parent, data, args)
     , m_useLocalPath(false)
     , m_maxImages(0) // Default: unlimited
+    , m_prefetchEnabled(true)
+    , m_prefetchLeadMinutes(60)
+    , m_prefetchOnMetered(false)
+    , m_prefetchOnBattery(false)
+    , m_downscaleToScreen(false)
 {
     loadConfig();
     
@@ -68,6 +71,11 @@ NextcloudProvider::NextcloudProvider(QObject *parent, const KPluginMetaData &dat
         }
     }
     
+    // Fast path: the scheduler already listed, downloaded and decoded the next image
+    if (usePreparedImage()) {
+        return;
+    }
+
     if (m_useLocalPath) {
         fetchImagesFromLocal();
     } else {
@@ -143,6 +151,82 @@ void NextcloudProvider::loadConfig()
     
     // Maximum number of images to load (0 = unlimited, default: 0)
     m_maxImages = nextcloudGroup.readEntry("MaxImages", 0);
+
+    // Prepare the next image in idle time before the next rotation (default: enabled, 60 minutes ahead)
+    m_prefetchEnabled = nextcloudGroup.readEntry("PrefetchEnabled", true);
+    m_prefetchLeadMinutes = nextcloudGroup.readEntry("PrefetchLeadMinutes", 60);
+    m_prefetchOnMetered = nextcloudGroup.readEntry("PrefetchOnMetered", false);
+    m_prefetchOnBattery = nextcloudGroup.readEntry("PrefetchOnBattery", false);
+
+    // Decode at most at screen size instead of full resolution (default: disabled, needs PrefetchEnabled)
+    m_downscaleToScreen = nextcloudGroup.readEntry("DownscaleToScreen", false);
+}
+
+NextcloudPrefetcher::Settings NextcloudProvider::prefetchSettings() const
+{
+    NextcloudPrefetcher::Settings settings;
+    settings.nextcloudUrl = m_nextcloudUrl;
+    settings.nextcloudPath = m_nextcloudPath;
+    settings.username = m_username;
+    settings.password = m_password;
+    settings.useLocalPath = m_useLocalPath;
+    settings.localPath = m_localPath;
+    settings.maxImages = m_maxImages;
+    settings.enabled = m_prefetchEnabled;
+    settings.leadMinutes = m_prefetchLeadMinutes;
+    settings.allowMetered = m_prefetchOnMetered;
+    settings.allowBattery = m_prefetchOnBattery;
+    settings.downscale = m_downscaleToScreen;
+    return settings;
+}
+
+bool NextcloudProvider::usePreparedImage()
+{
+    if (!m_prefetchEnabled) {
+        return false;
+    }
+
+    NextcloudPrefetcher::Prepared prepared = NextcloudPrefetcher::instance()->takePrepared(prefetchSettings());
+    if (prepared.image.isNull()) {
+        return false;
+    }
+
+    m_selectedImageUrl = prepared.url;
+    m_image = prepared.image;
+    setImageMetadata();
+    qCDebug(WALLPAPERPOTD) << "Using prepared image:" << m_selectedImageUrl;
+
+    // Queued: potd connects to finished() only after the constructor has returned
+    QMetaObject::invokeMethod(
+        this,
+        [this]() {
+            Q_EMIT finished(this, m_image);
+            scheduleNextRotation();
+        },
+        Qt::QueuedConnection);
+    return true;
+}
+
+QImage NextcloudProvider::readImageFile(const QString &path) const
+{
+    // With prefetch enabled, decode exactly like the prepared image so both paths give the same result
+    if (!m_prefetchEnabled) {
+        return QImage(path);
+    }
+    return NextcloudUtils::readImageFile(path, m_downscaleToScreen ? NextcloudUtils::screenTargetSize() : QSize());
+}
+
+QImage NextcloudProvider::readImageData(const QByteArray &data) const
+{
+    if (!m_prefetchEnabled) {
+        return QImage::fromData(data);
+    }
+    return NextcloudUtils::readImageData(data, m_downscaleToScreen ? NextcloudUtils::screenTargetSize() : QSize());
+}
+
+void NextcloudProvider::scheduleNextRotation()
+{
+    NextcloudPrefetcher::instance()->schedule(prefetchSettings(), m_selectedImageUrl);
 }
 
 void NextcloudProvider::fetchImagesFromWebDAV()
@@ -165,22 +249,9 @@ void NextcloudProvider::fetchImagesFromWebDAV()
     request.setRawHeader("Content-Type", "application/xml");
 
     // Set authentication
-    QString concatenated = m_username + QLatin1Char(':') + m_password;
-    QByteArray data = concatenated.toLocal8Bit().toBase64();
-    QString headerData = QStringLiteral("Basic ") + data;
-    request.setRawHeader("Authorization", headerData.toLocal8Bit());
-
-    // PROPFIND XML body
-    QByteArray propfindXml = R"(<?xml version="1.0"?>
-<d:propfind xmlns:d="DAV:">
-  <d:prop>
-    <d:resourcetype/>
-    <d:getcontenttype/>
-    <d:displayname/>
-  </d:prop>
-</d:propfind>)";
-
-    QNetworkReply *reply = manager->sendCustomRequest(request, "PROPFIND", propfindXml);
+    request.setRawHeader("Authorization", NextcloudUtils::authorizationHeader(m_username, m_password));
+
+    QNetworkReply *reply = manager->sendCustomRequest(request, "PROPFIND", NextcloudUtils::propfindListingBody());
     connect(reply, &QNetworkReply::finished, this, [this, reply, manager]() {
         propfindRequestFinished(reply);
         reply->deleteLater();
@@ -202,37 +273,9 @@ void NextcloudProvider::propfindRequestFinished(QNetworkReply *reply)
     }
 
     // Parse XML response
-    QXmlStreamReader xml(reply->readAll());
-    m_imageUrls.clear();
-
     // m_nextcloudUrl is normalized (no trailing slash)
     // href from PROPFIND is relative to the WebDAV root and starts with /
-    QString baseUrl = m_nextcloudUrl;
-
-    const QRegularExpression imageExtRegex(QStringLiteral("\\.(jpg|jpeg|png|bmp|webp|gif)$"), QRegularExpression::CaseInsensitiveOption);
-
-    while (!xml.atEnd()) {
-        xml.readNext();
-        if (xml.isStartElement() && xml.name() == QLatin1String("href")) {
-            QString href = xml.readElementText();
-            if (href.endsWith(QLatin1Char('/'))) {
-                continue; // Skip directories
-            }
-            if (imageExtRegex.match(href).hasMatch()) {
-                // href from PROPFIND is relative to the WebDAV root and starts with /
-                // baseUrl has no trailing slash, so concatenation is: baseUrl + href
-                // Example: "https://nemeyes.xyz" + "/remote.php/dav/files/..." = "https://nemeyes.xyz/remote.php/..."
-                QString fullUrl = baseUrl + href;
-                qCDebug(WALLPAPERPOTD) << "Building URL - baseUrl:" << baseUrl << "href:" << href << "fullUrl:" << fullUrl;
-                m_imageUrls.append(fullUrl);
-                
-                // Limit the number of images if MaxImages is set
-                if (m_maxImages > 0 && m_imageUrls.size() >= m_maxImages) {
-                    break;
-                }
-            }
-        }
-    }
+    m_imageUrls = NextcloudUtils::parseImageListing(reply->readAll(), m_nextcloudUrl, m_maxImages);
 
     if (m_imageUrls.isEmpty()) {
         qCWarning(WALLPAPERPOTD) << "No images found in Nextcloud";
@@ -278,19 +321,8 @@ void NextcloudProvider::fetchImagesFromLocal()
         return;
     }
 
-    m_imageUrls.clear();
-    const QStringList imageFilters = {QStringLiteral("*.jpg"), QStringLiteral("*.jpeg"), QStringLiteral("*.png"), QStringLiteral("*.bmp"), QStringLiteral("*.webp"), QStringLiteral("*.gif")};
-    
     // Search recursively in all subdirectories
-    QDirIterator it(m_localPath, imageFilters, QDir::Files | QDir::Readable, QDirIterator::Subdirectories);
-    while (it.hasNext()) {
-        m_imageUrls.append(it.next());
-        
-        // Limit the number of images if MaxImages is set
-        if (m_maxImages > 0 && m_imageUrls.size() >= m_maxImages) {
-            break;
-        }
-    }
+    m_imageUrls = NextcloudUtils::listLocalImages(m_localPath, m_maxImages);
 
     if (m_imageUrls.isEmpty()) {
         qCWarning(WALLPAPERPOTD) << "No images found in local path";
@@ -335,6 +367,46 @@ void NextcloudProvider::selectRandomImage()
     m_selectedImageUrl = m_imageUrls.at(index);
     qCDebug(WALLPAPERPOTD) << "Selected random image" << index << "of" << m_imageUrls.size() << ":" << m_selectedImageUrl;
 
+    setImageMetadata();
+
+    // Note: Cache invalidation is now done BEFORE selectRandomImage() is called
+    // (in propfindRequestFinished() or fetchImagesFromLocal())
+    // This ensures potd generates preview from the correct image
+
+    // Download image if it's a URL, or load directly if it's a local path
+    if (m_selectedImageUrl.startsWith(QStringLiteral("http://")) || m_selectedImageUrl.startsWith(QStringLiteral("https://"))) {
+        QUrl imageUrl(m_selectedImageUrl);
+        QNetworkAccessManager *manager = new QNetworkAccessManager(this);
+        QNetworkRequest request(imageUrl);
+
+        // Set authentication
+        request.setRawHeader("Authorization", NextcloudUtils::authorizationHeader(m_username, m_password));
+
+        QNetworkReply *reply = manager->get(request);
+        connect(reply, &QNetworkReply::finished, this, [this, reply, manager]() {
+            imageRequestFinished(reply);
+            reply->deleteLater();
+            manager->deleteLater();
+        });
+    } else {
+        // Local file
+        m_image = readImageFile(m_selectedImageUrl);
+        if (m_image.isNull()) {
+            Q_EMIT error(this);
+        } else {
+            // Debug: Verify metadata is set before emitting finished()
+            qCDebug(WALLPAPERPOTD) << "Emitting finished() (local) - RemoteUrl:" << m_remoteUrl.toString()
+                                   << "InfoUrl:" << m_infoUrl.toString()
+                                   << "Title:" << m_title
+                                   << "Author:" << m_author;
+            Q_EMIT finished(this, m_image);
+            scheduleNextRotation();
+        }
+    }
+}
+
+void NextcloudProvider::setImageMetadata()
+{
     // CRITICAL: Set remoteUrl IMMEDIATELY after selection
     // This ensures that if potd queries remoteUrl() for preview generation,
     // it will get the correct image URL, not an empty or cached one
@@ -372,43 +444,6 @@ void NextcloudProvider::selectRandomImage()
                            << "InfoUrl:" << m_infoUrl.toString()
                            << "Title:" << m_title
                            << "Author:" << m_author;
-    
-    // Note: Cache invalidation is now done BEFORE selectRandomImage() is called
-    // (in propfindRequestFinished() or fetchImagesFromLocal())
-    // This ensures potd generates preview from the correct image
-
-    // Download image if it's a URL, or load directly if it's a local path
-    if (m_selectedImageUrl.startsWith(QStringLiteral("http://")) || m_selectedImageUrl.startsWith(QStringLiteral("https://"))) {
-        QUrl imageUrl(m_selectedImageUrl);
-        QNetworkAccessManager *manager = new QNetworkAccessManager(this);
-        QNetworkRequest request(imageUrl);
-
-        // Set authentication
-        QString concatenated = m_username + QLatin1Char(':') + m_password;
-        QByteArray data = concatenated.toLocal8Bit().toBase64();
-        QString headerData = QStringLiteral("Basic ") + data;
-        request.setRawHeader("Authorization", headerData.toLocal8Bit());
-
-        QNetworkReply *reply = manager->get(request);
-        connect(reply, &QNetworkReply::finished, this, [this, reply, manager]() {
-            imageRequestFinished(reply);
-            reply->deleteLater();
-            manager->deleteLater();
-        });
-    } else {
-        // Local file
-        m_image = QImage(m_selectedImageUrl);
-        if (m_image.isNull()) {
-            Q_EMIT error(this);
-        } else {
-            // Debug: Verify metadata is set before emitting finished()
-            qCDebug(WALLPAPERPOTD) << "Emitting finished() (local) - RemoteUrl:" << m_remoteUrl.toString()
-                                   << "InfoUrl:" << m_infoUrl.toString()
-                                   << "Title:" << m_title
-                                   << "Author:" << m_author;
-            Q_EMIT finished(this, m_image);
-        }
-    }
 }
 
 void NextcloudProvider::imageRequestFinished(QNetworkReply *reply)
@@ -425,7 +460,7 @@ void NextcloudProvider::imageRequestFinished(QNetworkReply *reply)
     }
 
     QByteArray imageData = reply->readAll();
-    m_image = QImage::fromData(imageData);
+    m_image = readImageData(imageData);
 
     if (m_image.isNull()) {
         qCWarning(WALLPAPERPOTD) << "Failed to load image from data";
@@ -437,6 +472,7 @@ void NextcloudProvider::imageRequestFinished(QNetworkReply *reply)
                                << "Title:" << m_title
                                << "Author:" << m_author;
         Q_EMIT finished(this, m_image);
+        scheduleNextRotation();
     }
 }
 
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include "nextcloudprefetcher.h"
 #include "potdprovider.h"
 
 #include <QDate>
@@ -37,6 +38,12 @@ private:
     void fetchImagesFromWebDAV();
     void fetchImagesFromLocal();
     void selectRandomImage();
+    void setImageMetadata();
+    bool usePreparedImage();
+    void scheduleNextRotation();
+    NextcloudPrefetcher::Settings prefetchSettings() const;
+    QImage readImageFile(const QString &path) const;
+    QImage readImageData(const QByteArray &data) const;
 
     // Configuration
     QString m_nextcloudUrl;
@@ -53,5 +60,12 @@ private:
     
     // Maximum number of images to load (0 = unlimited)
     int m_maxImages;
+
+    // Preparation of the next image ahead of rotation
+    bool m_prefetchEnabled;
+    int m_prefetchLeadMinutes;
+    bool m_prefetchOnMetered;
+    bool m_prefetchOnBattery;
+    bool m_downscaleToScreen;
 };
 
@@ -0,0 +1,153 @@
+/*
+ *   SPDX-FileCopyrightText: 2024 Nextcloud Wallpaper Plugin
+ *
+ *   SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "nextcloudutils.h"
+
+#include <QBuffer>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QImageReader>
+#include <QScreen>
+#include <QXmlStreamReader>
+
+#include "debug.h"
+
+namespace
+{
+const QStringList &imageExtensions()
+{
+    static const QStringList extensions = {QStringLiteral("jpg"), QStringLiteral("jpeg"), QStringLiteral("png"), QStringLiteral("bmp"), QStringLiteral("webp"), QStringLiteral("gif")};
+    return extensions;
+}
+
+QImage readImage(QImageReader &reader, const QSize &target)
+{
+    reader.setAutoTransform(true);
+
+    // Decode directly at the target resolution; QImageReader lets JPEG skip most of the work
+    const QSize size = reader.size();
+    if (target.isValid() && size.isValid() && size.width() > target.width() && size.height() > target.height()) {
+        reader.setScaledSize(size.scaled(target, Qt::KeepAspectRatioByExpanding));
+    }
+
+    return reader.read();
+}
+}
+
+namespace NextcloudUtils
+{
+QStringList imageNameFilters()
+{
+    QStringList filters;
+    for (const QString &extension : imageExtensions()) {
+        filters.append(QStringLiteral("*.") + extension);
+    }
+    return filters;
+}
+
+bool isImagePath(const QString &path)
+{
+    return imageExtensions().contains(QFileInfo(path).suffix(), Qt::CaseInsensitive);
+}
+
+QByteArray authorizationHeader(const QString &username, const QString &password)
+{
+    const QString concatenated = username + QLatin1Char(':') + password;
+    return QByteArrayLiteral("Basic ") + concatenated.toLocal8Bit().toBase64();
+}
+
+QByteArray propfindListingBody()
+{
+    return QByteArrayLiteral(R"(<?xml version="1.0"?>
+<d:propfind xmlns:d="DAV:">
+  <d:prop>
+    <d:resourcetype/>
+    <d:getcontenttype/>
+    <d:displayname/>
+  </d:prop>
+</d:propfind>)");
+}
+
+QStringList parseImageListing(const QByteArray &xml, const QString &baseUrl, int maxImages)
+{
+    QStringList imageUrls;
+    QXmlStreamReader reader(xml);
+
+    while (!reader.atEnd()) {
+        reader.readNext();
+        if (reader.isStartElement() && reader.name() == QLatin1String("href")) {
+            const QString href = reader.readElementText();
+            if (href.endsWith(QLatin1Char('/'))) {
+                continue; // Skip directories
+            }
+            if (isImagePath(href)) {
+                // href from PROPFIND is relative to the WebDAV root and starts with /
+                // baseUrl has no trailing slash, so concatenation is: baseUrl + href
+                // Example: "https://nemeyes.xyz" + "/remote.php/dav/files/..." = "https://nemeyes.xyz/remote.php/..."
+                const QString fullUrl = baseUrl + href;
+                qCDebug(WALLPAPERPOTD) << "Building URL - baseUrl:" << baseUrl << "href:" << href << "fullUrl:" << fullUrl;
+                imageUrls.append(fullUrl);
+
+                // Limit the number of images if MaxImages is set
+                if (maxImages > 0 && imageUrls.size() >= maxImages) {
+                    break;
+                }
+            }
+        }
+    }
+
+    return imageUrls;
+}
+
+QStringList listLocalImages(const QString &path, int maxImages)
+{
+    QStringList imageUrls;
+
+    // Search recursively in all subdirectories
+    QDirIterator it(path, imageNameFilters(), QDir::Files | QDir::Readable, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        imageUrls.append(it.next());
+
+        // Limit the number of images if MaxImages is set
+        if (maxImages > 0 && imageUrls.size() >= maxImages) {
+            break;
+        }
+    }
+
+    return imageUrls;
+}
+
+QSize screenTargetSize()
+{
+    QSize size;
+    if (!qobject_cast<QGuiApplication *>(QCoreApplication::instance())) {
+        return size;
+    }
+    const auto screens = QGuiApplication::screens();
+    for (const QScreen *screen : screens) {
+        const QSize screenSize = screen->geometry().size() * screen->devicePixelRatio();
+        size = size.expandedTo(screenSize);
+    }
+    return size;
+}
+
+QImage readImageFile(const QString &path, const QSize &target)
+{
+    QImageReader reader(path);
+    return readImage(reader, target);
+}
+
+QImage readImageData(const QByteArray &data, const QSize &target)
+{
+    QBuffer buffer;
+    buffer.setData(data);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer);
+    return readImage(reader, target);
+}
+}
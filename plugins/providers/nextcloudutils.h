@@ -0,0 +1,68 @@
+/*
+ *   SPDX-FileCopyrightText: 2024 Nextcloud Wallpaper Plugin
+ *
+ *   SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+
+/**
+ * Listing, authentication and decoding shared by the provider and the prefetcher,
+ * so both agree on what counts as an image and how it is loaded
+ */
+namespace NextcloudUtils
+{
+/**
+ * Name filters for the supported image formats (e.g. "*.jpg")
+ */
+QStringList imageNameFilters();
+
+/**
+ * Whether @p path (local path or WebDAV href) has a supported image extension
+ */
+bool isImagePath(const QString &path);
+
+/**
+ * Value of the HTTP Basic "Authorization" header
+ */
+QByteArray authorizationHeader(const QString &username, const QString &password);
+
+/**
+ * PROPFIND body used to list the image folder
+ */
+QByteArray propfindListingBody();
+
+/**
+ * Extracts image URLs from a PROPFIND response; hrefs are resolved against @p baseUrl.
+ * At most @p maxImages entries are returned (0 = unlimited).
+ */
+QStringList parseImageListing(const QByteArray &xml, const QString &baseUrl, int maxImages);
+
+/**
+ * Recursively lists images below @p path, at most @p maxImages entries (0 = unlimited)
+ */
+QStringList listLocalImages(const QString &path, int maxImages);
+
+/**
+ * Largest screen size in device pixels, invalid without a GUI application.
+ * Wallpapers are decoded at most this large.
+ */
+QSize screenTargetSize();
+
+/**
+ * Decodes an image file, applying EXIF orientation.
+ * If @p target is valid, images larger than it are decoded at reduced size.
+ */
+QImage readImageFile(const QString &path, const QSize &target = QSize());
+
+/**
+ * Same as readImageFile() for downloaded data
+ */
+QImage readImageData(const QByteArray &data, const QSize &target = QSize());
+}